@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Host build of the game for batch runs. The Pico SDK is replaced by the
+ * stand-ins in stubs/, the game's output is dropped, and a simple player
+ * takes the place of the console so whole games run without prompts.
+ *
+ * usage: wump_bench [games per behavior]
+ *
+ * Also times the console line editor and command parser on a long pasted
+ * stream of commands.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Game output is dropped
+static int game_printf(const char* fmt, ...) {
+    (void)fmt;
+    return 0;
+}
+static int game_putchar(int c) { return c; }
+static int game_fputs(const char* s, FILE* f) {
+    (void)s;
+    (void)f;
+    return 0;
+}
+static size_t game_fwrite(const void* p, size_t size, size_t n, FILE* f) {
+    (void)p;
+    (void)size;
+    (void)f;
+    return n;
+}
+static int game_fflush(FILE* f) {
+    (void)f;
+    return 0;
+}
+
+#define printf game_printf
+#define putchar game_putchar
+#define fputs game_fputs
+#define fwrite game_fwrite
+#define fflush game_fflush
+#define main wump_main
+
+#include "../wumpus.c"
+
+#undef printf
+#undef putchar
+#undef fputs
+#undef fwrite
+#undef fflush
+#undef main
+
+// SDK stand-in state
+uint8_t host_flash[FLASH_SECTOR_SIZE];
+const char* host_input;
+const char* host_input_end;
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Batch games
+
+#define MAX_TURNS 1000 // a game this long is a loss
+#define CAVE_REUSE 100 // games played in each cave
+
+static uint64_t transitions; // state machine steps taken
+
+// A simple player. It shoots two rooms deep when the wumpus is within two
+// rooms and wanders otherwise.
+static event_t bot_turn(void) {
+    cmd.status = CMD_OK;
+    cmd.room[0] = rooms[loc][random_number(N_TUNNELS)];
+    if (dist[loc][wloc] <= 2) {
+        uint32_t r;
+        do
+            r = rooms[cmd.room[0]][random_number(N_TUNNELS)];
+        while (r == loc);
+        cmd.verb = 's';
+        cmd.room[1] = r;
+        cmd.n_rooms = 2;
+        return EV_SHOOT;
+    }
+    cmd.verb = 'm';
+    cmd.n_rooms = 1;
+    return EV_MOVE;
+}
+
+// Play one game from the given state, true if won
+static bool play(state_t state) {
+    for (uint32_t turns = 0; turns < MAX_TURNS;) {
+        event_t ev;
+        if (state == ST_AGAIN) {
+            ev = bot_turn();
+            turns++;
+        } else if (state == ST_DONE)
+            return wumpus_slain;
+        else
+            ev = handler[state]();
+        state = transition[state][ev];
+        transitions++;
+        assert(state != ST_NONE);
+    }
+    return false;
+}
+
+// Win rate for each wumpus behavior
+static void batch(uint32_t games) {
+    printf("%u rooms, %u tunnels, %u games per behavior\n", N_ROOMS, N_TUNNELS, games);
+    for (wumpus = 0; wumpus < N_WUMPUS; wumpus++) {
+        srand(1);
+        uint32_t won = 0;
+        transitions = 0;
+        double t = seconds();
+        for (uint32_t g = 0; g < games; g++)
+            won += play((g % CAVE_REUSE) ? ST_SETUP : ST_INIT_CAVE);
+        t = seconds() - t;
+        printf("  wumpus %-8s win rate %6.2f%%  %6.2f M games/min  %6.2f M transitions/s\n",
+               wumpus_name[wumpus], 100.0 * won / games, games / t * 60e-6,
+               transitions / t * 1e-6);
+    }
+}
+
+// Command parsing
+
+#define PASTE_BYTES (1 << 20) // size of the pasted command stream
+#define PASTE_REPEAT 20       // times through it
+
+// Throughput of the line editor and parser on a long pasted stream of
+// commands, with a few arrow key recalls mixed in
+static void parse(void) {
+    static const char* const lines[] = {
+        "m 7\r",      "s 1 2 3 4 5\r", "S 12 3\n",     "\x1b[A\r", " m  14 \r",
+        "s 9 99 3\r", "m 1\b2\r",     "\x1bOA\x1bOB\r", "q\r",
+    };
+    char* paste = malloc(PASTE_BYTES);
+    uint32_t len = 0, n_lines = 0;
+    for (uint32_t i = 0;; i = (i + 1) % (sizeof(lines) / sizeof(lines[0]))) {
+        uint32_t l = strlen(lines[i]);
+        if (len + l > PASTE_BYTES)
+            break;
+        memcpy(paste + len, lines[i], l);
+        len += l;
+        n_lines++;
+    }
+    uint32_t rooms_seen = 0;
+    double t = seconds();
+    for (uint32_t i = 0; i < PASTE_REPEAT; i++)
+        for (host_input = paste, host_input_end = paste + len; host_input < host_input_end;) {
+            get_and_parse_cmd();
+            rooms_seen += cmd.n_rooms;
+        }
+    t = seconds() - t;
+    printf("parse, %u byte stream\n", len);
+    printf("  %6.2f M lines/s  %7.2f MB/s  (%u rooms)\n", n_lines * (double)PASTE_REPEAT / t * 1e-6,
+           len * (double)PASTE_REPEAT / t * 1e-6, rooms_seen);
+    free(paste);
+}
+
+int main(int argc, char** argv) {
+    uint32_t games = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000000;
+    if (games == 0)
+        games = 1;
+    batch(games);
+    parse();
+    return 0;
+}
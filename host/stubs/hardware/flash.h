@@ -0,0 +1,21 @@
+// Host stand-in for the Pico SDK flash API, backed by a RAM sector
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#define FLASH_PAGE_SIZE 256
+#define FLASH_SECTOR_SIZE 4096
+
+extern uint8_t host_flash[FLASH_SECTOR_SIZE];
+
+#define XIP_BASE ((uintptr_t)host_flash)
+#define PICO_FLASH_SIZE_BYTES FLASH_SECTOR_SIZE
+
+static inline void flash_range_erase(uint32_t offset, size_t count) {
+    memset(host_flash + offset, 0xff, count);
+}
+
+static inline void flash_range_program(uint32_t offset, const uint8_t* data, size_t count) {
+    memcpy(host_flash + offset, data, count);
+}
@@ -0,0 +1,8 @@
+// Host stand-in for the Pico SDK sync API
+#pragma once
+
+#include <stdint.h>
+
+static inline uint32_t save_and_disable_interrupts(void) { return 0; }
+static inline void restore_interrupts(uint32_t status) { (void)status; }
+static inline void __wfi(void) {}
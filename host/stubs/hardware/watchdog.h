@@ -0,0 +1,2 @@
+// Host stand-in for the Pico SDK watchdog API, unused by the game
+#pragma once
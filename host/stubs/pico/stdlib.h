@@ -0,0 +1,29 @@
+// Host stand-in for the Pico SDK standard library. Console input is read
+// from a memory buffer the host program sets up.
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PICO_ERROR_TIMEOUT (-1)
+
+extern const char* host_input;
+extern const char* host_input_end;
+
+static inline int getchar_timeout_us(uint32_t timeout_us) {
+    (void)timeout_us;
+    return (host_input < host_input_end) ? (uint8_t)*host_input++ : PICO_ERROR_TIMEOUT;
+}
+
+// Blocking read, an exhausted buffer reads as end of line
+static inline int host_getchar(void) {
+    int c = getchar_timeout_us(0);
+    return (c == PICO_ERROR_TIMEOUT) ? '\r' : c;
+}
+#define getchar() host_getchar()
+
+static inline void sleep_ms(uint32_t ms) { (void)ms; }
+static inline uint32_t time_us_32(void) { return 0; }
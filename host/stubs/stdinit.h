@@ -0,0 +1,4 @@
+// Host stand-in for stdinit-lib
+#pragma once
+
+static inline void stdio_init(void) {}
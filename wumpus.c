@@ -15,9 +15,33 @@
  */
 
 // Enable cheat commands to dump the cave map and best shot.
+// Always enabled in debug builds.
 #if !defined(CHEAT)
 #define CHEAT 0
 #endif
+#if !defined(NDEBUG) && !CHEAT
+#undef CHEAT
+#define CHEAT 1
+#endif
+
+// Wumpus behaviors, once disturbed
+#define WUMPUS_RANDOM 0 // move at random or stay put
+#define WUMPUS_FLEE 1   // keep away from the player
+#define WUMPUS_STALK 2  // close in on the player
+#define WUMPUS_DODGE 3  // keep off the last arrow's path
+#define N_WUMPUS 4
+
+#if !defined(WUMPUS)
+#define WUMPUS WUMPUS_RANDOM
+#endif
+
+// Cave size, normally set by the build
+#if !defined(N_ROOMS)
+#define N_ROOMS 20 // must be even, 32 at most
+#endif
+#if !defined(N_TUNNELS)
+#define N_TUNNELS 3 // tunnels per room
+#endif
 
 #include "hardware/flash.h"
 #include "hardware/sync.h"
@@ -25,6 +49,7 @@
 
 #include "pico/stdlib.h"
 
+#include "stdarg.h"
 #include "stdlib.h"
 #include "stdio.h"
 
@@ -33,157 +58,412 @@
 #define likely(x) __builtin_expect((x), 1)
 #define unlikely(x) __builtin_expect((x), 0)
 
+// Fully unroll a loop with a compile time trip count
+#define do_pragma(x) _Pragma(#x)
+#define unroll(n) do_pragma(GCC unroll n)
+
+// Pause between the rooms of an arrow's flight, 0 for batch games
+#if !defined(ARROW_DELAY_MS)
+#define ARROW_DELAY_MS 500
+#endif
+
 // Boundaries
 #define N_BATS 3         // 3 bats
-#define N_ROOMS 20       // must be even
-#define N_TUNNELS 3      // must be 3
 #define N_PITS 3         // 3 pits
 #define N_ARROWS 5       // 5 shots
 #define N_ARROW_PATH 5   // arrow visits 5 rooms
 
+_Static_assert(!(N_ROOMS & 1) && (N_ROOMS <= 32), "N_ROOMS must be even and no more than 32");
+_Static_assert((N_TUNNELS >= 2) && (N_TUNNELS < N_ROOMS), "N_TUNNELS out of range");
+_Static_assert(N_PITS + N_BATS + 2 <= N_ROOMS, "Not enough rooms for the hazards");
+
+// Bitmap of all rooms
+#define ALL_ROOMS ((uint32_t)-1 >> (32 - N_ROOMS))
+
 // Room flags
 #define HAZ_BAT ((uint8_t)(1 << 0))
 #define HAZ_PIT ((uint8_t)(1 << 1))
 #define HAZ_WUMPUS ((uint8_t)(1 << 2))
-#define HAZ_VISIT ((uint8_t)(1 << 3))
 
 // Tunnel flag
 #define UN_MAPPED ((uint8_t)-1)
 
 typedef uint8_t map_t[N_ROOMS][N_TUNNELS];
 
-static uint32_t cave, empty_cave;        // cave bitmaps
+_Static_assert(sizeof(map_t) <= FLASH_PAGE_SIZE, "Tunnel map must fit in a flash page");
+
+static uint32_t cave;                    // cave bitmap
 static uint32_t arrow, loc, wloc;        // arrow count, player and wumpus locations
+static uint32_t arrow_path;              // bitmap of rooms the last arrow went through
+static uint32_t wumpus = WUMPUS;         // wumpus behavior
+static bool wumpus_slain;                // the game was won
 static uint8_t flags[N_ROOMS];           // array of room  flags
-static union {
-    map_t rooms; // tunnel map
-    uint8_t sector[FLASH_PAGE_SIZE];
-} buf;
+static map_t rooms;                      // tunnel map
+static uint8_t dist[N_ROOMS][N_ROOMS];   // tunnels between any two rooms
 static bool new_cave = false;
 
-// Instructions
+// Text compression. Bytes 0x80 and up in the packed strings below index
+// this static dictionary of common fragments, anything else is plain ASCII.
 // clang-format off
-static const char* intro1 =
+#define D_THE     "\x80" // " the "
+#define D_ROOM    "\x81" // "room"
+#define D_YOU     "\x82" // "you"
+#define D_ARROW   "\x83" // "arrow"
+#define D_WUMPUS  "\x84" // "wumpus"
+#define D_CWUMPUS "\x85" // "Wumpus"
+#define D_TUNNEL  "\x86" // "tunnel"
+#define D_TO      "\x87" // " to "
+#define D_AND     "\x88" // " and "
+#define D_IN      "\x89" // " in "
+#define D_ONE     "\x8a" // "one "
+#define D_NL2     "\x8b" // "\n\n"
+#define D_BARS    "\x8c" // "| |"
+#define D_SP2     "\x8d" // "  "
+#define D_SP4     "\x8e" // "    "
+#define D_SP8     "\x8f" // "        "
+
+static const char dictionary[] =
+    " the \0"
+    "room\0"
+    "you\0"
+    "arrow\0"
+    "wumpus\0"
+    "Wumpus\0"
+    "tunnel\0"
+    " to \0"
+    " and \0"
+    " in \0"
+    "one \0"
+    "\n\n\0"
+    "| |\0"
+    "  \0"
+    "    \0"
+    "        \0";
+
+// What the wumpus does when woken, as built
+#define T_EATS "he eats " D_YOU " up" D_AND D_YOU " lose!"
+#if WUMPUS == WUMPUS_FLEE
+#define T_WAKES "he moves " D_ONE D_ROOM " further from " D_YOU "\n" \
+    "or stays where he was. But if he ends up where " D_YOU " are,\n" T_EATS
+#elif WUMPUS == WUMPUS_STALK
+#define T_WAKES "he moves " D_ONE D_ROOM " closer" D_TO D_YOU ".\n" \
+    "If he ends up where " D_YOU " are, " T_EATS
+#elif WUMPUS == WUMPUS_DODGE
+#define T_WAKES "he moves " D_ONE D_ROOM " or stays where he\n" \
+    "was, keeping off" D_THE "last " D_ARROW "'s path. But if he\n" \
+    "ends up where " D_YOU " are, " T_EATS
+#else
+#define T_WAKES "he either decides" D_TO "move " D_ONE D_ROOM " or\n" \
+    "stay where he was. But if he ends up where " D_YOU " are,\n" T_EATS
+#endif
+
+// Tunnels per room in words where it reads better
+#if N_TUNNELS == 2
+#define T_TUNNELS "two"
+#elif N_TUNNELS == 3
+#define T_TUNNELS "three"
+#elif N_TUNNELS == 4
+#define T_TUNNELS "four"
+#elif N_TUNNELS == 5
+#define T_TUNNELS "five"
+#else
+#define T_TUNNELS "%d"
+#endif
+
+// Instructions
+static const char intro1[] =
     "\n"
-    "The Wumpus lives in a cave of %d rooms.\n"
-    "Each room has %d tunnels leading to other rooms.\n\n"
-    "Hazards:\n\n"
-    "Bottomless Pits - %d rooms have Bottomless Pits in them.\n"
-    " If you go there, you fall into the pit and lose!\n"
-    "Super Bats - %d other rooms have super bats.\n"
-    " If you go there, a bat will grab you and take you to\n"
-    " somewhere else in the cave where you could\n"
-    " fall into a pit or run into the . . .\n\n"
-    "Wumpus:\n\n"
-    "The Wumpus is not bothered by the hazards since\n"
-    "he has sucker feet and is too big for a bat to lift.\n\n"
+    "The " D_CWUMPUS " lives" D_IN "a cave of %d " D_ROOM "s.\n"
+    "Each " D_ROOM " has %d " D_TUNNEL "s leading" D_TO "other " D_ROOM "s." D_NL2
+    "Hazards:" D_NL2
+    "Bottomless Pits - %d " D_ROOM "s have Bottomless Pits" D_IN "them.\n"
+    " If " D_YOU " go there, " D_YOU " fall into" D_THE "pit" D_AND "lose!\n"
+    "Super Bats - %d other " D_ROOM "s have super bats.\n"
+    " If " D_YOU " go there, a bat will grab " D_YOU D_AND "take " D_YOU " to\n"
+    " somewhere else" D_IN "the cave where " D_YOU " could\n"
+    " fall into a pit or run into" D_THE ". . ." D_NL2
+    D_CWUMPUS ":" D_NL2
+    "The " D_CWUMPUS " is not bothered by" D_THE "hazards since\n"
+    "he has sucker feet" D_AND "is too big for a bat" D_TO "lift." D_NL2
     "Usually he is asleep. Two things wake him up:\n"
-    " your entering his room\n"
-    " your shooting an arrow anywhere in the cave.\n"
-    "If the wumpus wakes, he either decides to move one room or\n"
-    "stay where he was. But if he ends up where you are,\n"
-    "he eats you up and you lose!\n\n";
-static const char* intro2 =
-    "You:\n\n"
-    "Each turn you may either move or shoot a crooked arrow.\n\n"
-    "Moving - You can move to one of the adjoining rooms;\n"
-    " that is, to one that has a tunnel connecting it with\n"
-    " the room you are in.\n\n"
-    "Shooting - You have %d arrows. You lose when you run out.\n"
-    " Each arrow can go from 1 to %d rooms.\n"
-    " You aim by telling the computer\n"
-    " The arrow's path is a list of room numbers\n"
-    " telling the arrow which room to go to next.\n"
-    " The first room in the path must be connected to the\n"
-    " room you are in. Each succeeding room must be\n"
-    " connected to the previous room.\n"
-    " If there is no tunnel between two of the rooms\n"
-    " in the arrow's path, the arrow chooses one of the\n"
-    " three tunnels from the room it's in and goes its\n"
-    " own way.\n\n"
-    " If the arrow hits the wumpus, you win!\n"
-    " If the arrow hits you, you lose!\n\n";
-static const char* intro3 =
-    "Warnings:\n\n"
-    "When you are one or two rooms away from the wumpus,\n"
+    " " D_YOU "r entering his " D_ROOM "\n"
+    " " D_YOU "r shooting an " D_ARROW " anywhere" D_IN "the cave.\n"
+    "If" D_THE D_WUMPUS " wakes, " T_WAKES D_NL2;
+static const char intro2[] =
+    "You:" D_NL2
+    "Each turn " D_YOU " may either move or shoot a crooked " D_ARROW "." D_NL2
+    "Moving - You can move" D_TO D_ONE "of" D_THE "adjoining " D_ROOM "s;\n"
+    " that is," D_TO D_ONE "that has a " D_TUNNEL " connecting it with\n"
+    D_THE D_ROOM " " D_YOU " are in." D_NL2
+    "Shooting - You have %d " D_ARROW "s. You lose when " D_YOU " run out.\n"
+    " Each " D_ARROW " can go from 1" D_TO "%d " D_ROOM "s.\n"
+    " You aim by telling" D_THE "computer\n"
+    " The " D_ARROW "'s path is a list of " D_ROOM " numbers\n"
+    " telling" D_THE D_ARROW " which " D_ROOM D_TO "go" D_TO "next.\n"
+    " The first " D_ROOM D_IN "the path must be connected" D_TO "the\n"
+    " " D_ROOM " " D_YOU " are in. Each succeeding " D_ROOM " must be\n"
+    " connected" D_TO "the previous " D_ROOM ".\n"
+    " If there is no " D_TUNNEL " between two of" D_THE D_ROOM "s\n"
+    D_IN "the " D_ARROW "'s path," D_THE D_ARROW " chooses " D_ONE "of the\n"
+    " " T_TUNNELS " " D_TUNNEL "s from" D_THE D_ROOM " it's" D_IN "and goes its\n"
+    " own way." D_NL2
+    " If" D_THE D_ARROW " hits" D_THE D_WUMPUS ", " D_YOU " win!\n"
+    " If" D_THE D_ARROW " hits " D_YOU ", " D_YOU " lose!" D_NL2;
+static const char intro3[] =
+    "Warnings:" D_NL2
+    "When " D_YOU " are " D_ONE "or two " D_ROOM "s away from" D_THE D_WUMPUS ",\n"
     "the computer says:\n"
-    "   'I smell a Wumpus'\n"
-    "When you are one room away from some other hazard, it says:\n"
-    "   Bat    - 'Bats nearby'\n"
-    "   Pit    - 'I feel a draft'\n";
+    D_SP2 " 'I smell a " D_CWUMPUS "'\n"
+    "When " D_YOU " are " D_ONE D_ROOM " away from some other hazard, it says:\n"
+    D_SP2 " Bat" D_SP4 "- 'Bats nearby'\n"
+    D_SP2 " Pit" D_SP4 "- 'I feel a draft'\n";
 
-const char* banner =
+static const char banner[] =
     "\n"
-    " _   _             _     _____ _\n"
-    "| | | |           | |   |_   _| |\n"
-    "| |_| |_   _ _ __ | |_    | | | |__   ___\n"
-    "|  _  | | | | '_ \\| __|   | | | '_ \\ / _ \\\n"
-    "| | | | |_| | | | | |_    | | | | | |  __/\n"
-    "\\_| |_/\\__,_|_| |_|\\__|   \\_/ |_| |_|\\___|\n\n"
-    " _    _\n"
-    "| |  | |\n"
-    "| |  | |_   _ _ __ ___  _ __  _   _ ___\n"
-    "| |/\\| | | | | '_ ` _ \\| '_ \\| | | / __|\n"
-    "\\  /\\  / |_| | | | | | | |_) | |_| \\__ \\\n"
-    " \\/  \\/ \\__,_|_| |_| |_| .__/ \\__,_|___/\n"
-    "                       | |\n"
-    "                       |_|\n\n";
+    " _" D_SP2 " _" D_SP8 D_SP4 " _" D_SP4 " _____ _\n"
+    D_BARS " " D_BARS D_SP8 D_SP2 " " D_BARS D_SP2 " |_" D_SP2 " _" D_BARS "\n"
+    D_BARS "_" D_BARS "_" D_SP2 " _ _ __ " D_BARS "_" D_SP4 D_BARS " " D_BARS "__" D_SP2 " ___\n"
+    "|" D_SP2 "_" D_SP2 D_BARS " " D_BARS " '_ \\| __|" D_SP2 " " D_BARS " | '_ \\ / _ \\\n"
+    D_BARS " " D_BARS " |_" D_BARS " " D_BARS " " D_BARS "_" D_SP4 D_BARS " " D_BARS " " D_BARS D_SP2 "__/\n"
+    "\\_" D_BARS "_/\\__,_|_" D_BARS "_|\\__|" D_SP2 " \\_/ |_" D_BARS "_|\\___|" D_NL2
+    " _" D_SP4 "_\n"
+    D_BARS D_SP2 D_BARS "\n"
+    D_BARS D_SP2 D_BARS "_" D_SP2 " _ _ __ ___" D_SP2 "_ __" D_SP2 "_" D_SP2 " _ ___\n"
+    D_BARS "/\\" D_BARS " " D_BARS " | '_ ` _ \\| '_ \\" D_BARS " | / __|\n"
+    "\\" D_SP2 "/\\" D_SP2 "/ |_" D_BARS " " D_BARS " " D_BARS " " D_BARS "_) " D_BARS "_| \\__ \\\n"
+    " \\/" D_SP2 "\\/ \\__,_|_" D_BARS "_" D_BARS "_| .__/ \\__,_|___/\n"
+    D_SP8 D_SP8 D_SP4 D_SP2 " " D_BARS "\n"
+    D_SP8 D_SP8 D_SP4 D_SP2 " |_|" D_NL2;
 // clang-format on
 
+// Stream a packed string, expanding dictionary references and %d conversions
+static void print_packed(const char* s, ...) {
+    va_list ap;
+    va_start(ap, s);
+    for (uint8_t c; (c = *s++) != 0;)
+        if (c & 0x80) {
+            const char* d = dictionary;
+            for (c &= 0x7f; c; c--)
+                while (*d++)
+                    ;
+            fputs(d, stdout);
+        } else if (unlikely((c == '%') && (*s == 'd'))) {
+            s++;
+            printf("%d", va_arg(ap, int));
+        } else
+            putchar(c);
+    va_end(ap);
+}
+
 // Near uniform distribution 0..n-1
 #define BITS_USED 24
 static inline uint32_t random_number(uint32_t n) {
     return ((rand() & ((1 << BITS_USED) - 1)) * n) >> BITS_USED;
 }
 
+// Scratch arena. These buffers are never live at the same time so they
+// share the same RAM.
+static union {
+    struct {
+        char line[64]; // line being edited
+        char echo[32]; // pending echo
+    } con;             // console input
+    uint8_t sector[FLASH_PAGE_SIZE]; // flash page image of the tunnel map
+#if (N_ROOMS == 20) && (N_TUNNELS == 3)
+    struct {
+        uint8_t A[N_ROOMS][N_ROOMS];
+        uint8_t B[N_ROOMS][N_ROOMS];
+        uint8_t T[N_ROOMS][N_ROOMS];
+    } m; // dodecahedron detector matrices
+#endif // (N_ROOMS == 20) && (N_TUNNELS == 3)
+} scratch;
+
 // Console input
-static uint32_t argc;
-static char* argv[N_ARROW_PATH + 1];
-static char cmd_buffer[64];
 
-static void get_and_parse_cmd(void) {
-    // read line into buffer
-    char c;
-    char* cp = cmd_buffer;
-    char* cp_end = cp + sizeof(cmd_buffer);
-    do {
+#define N_HISTORY 4    // recallable commands
+#define ESC_WAIT_US 1000 // a few character times at 115200 baud
+
+// Command status
+#define CMD_OK 0
+#define CMD_BAD_ROOM 1 // not a room number
+#define CMD_TOO_MANY 2 // more rooms than an arrow can visit
+
+// Parsed command line
+typedef struct {
+    char verb;                  // lower case 1st character, 0 for a blank line
+    uint8_t status;             // CMD_OK, CMD_BAD_ROOM or CMD_TOO_MANY
+    uint8_t n_rooms;            // number of rooms following the verb
+    uint8_t room[N_ARROW_PATH]; // zero based room numbers
+    const char* bad_room;       // offending room number as typed, in the line buffer
+    uint8_t bad_len;            // and its length
+} cmd_t;
+
+static cmd_t cmd;                   // last command entered
+static cmd_t history[N_HISTORY];    // most recent first
+static uint32_t history_len, echo_len;
+
+static void echo_flush(void) {
+    fwrite(scratch.con.echo, 1, echo_len, stdout);
+    fflush(stdout);
+    echo_len = 0;
+}
+
+static inline void echo(char c) {
+    if (unlikely(echo_len == sizeof(scratch.con.echo)))
+        echo_flush();
+    scratch.con.echo[echo_len++] = c;
+}
+
+// Only echo once the input runs dry, so pasted text goes out in batches
+static int read_char(void) {
+    int c = getchar_timeout_us(0);
+    if (c == PICO_ERROR_TIMEOUT) {
+        echo_flush();
         c = getchar();
-        putchar(c);
-        if (c == '\r')
-            putchar('\n');
-        if (unlikely(c == '\b')) {
-            if (likely(cp != cmd_buffer)) {
-                cp--;
-                printf(" \b");
-                fflush(stdout);
-            }
-        } else if (likely(cp < cp_end))
-            *cp++ = c;
-    } while (likely((c != '\r') && (c != '\n')));
-    // parse buffer
-    cp = cmd_buffer;
-    bool not_last = true;
-    for (argc = 0; likely(not_last && (argc <= N_ARROW_PATH)); argc++) {
-        while ((*cp == ' ') || (*cp == ','))
-            cp++; // skip blanks
-        if ((*cp == '\r') || (*cp == '\n'))
-            break;
-        argv[argc] = cp; // start of string
-        while ((*cp != ' ') && (*cp != ',') && (*cp != '\r') && (*cp != '\n'))
-            cp++; // skip non blank
-        if ((*cp == '\r') || (*cp == '\n'))
-            not_last = false;
-        *cp++ = 0; // terminate string
     }
-    if (likely(argc))
-        *argv[0] |= ' '; // to lower lowercase
+    return c;
 }
 
-#if N_ROOMS == 20 // dodecahedron must have 20 rooms
+static inline bool is_blank(char c) { return (c == ' ') || (c == ','); }
+
+// Single pass over the line, no copies. Room numbers are converted here
+// and nowhere else.
+static void parse_cmd(const char* cp, const char* end) {
+    cmd.verb = 0;
+    cmd.status = CMD_OK;
+    cmd.n_rooms = 0;
+    while (cp < end) {
+        if (is_blank(*cp)) {
+            cp++;
+            continue;
+        }
+        if (unlikely(!cmd.verb)) {
+            cmd.verb = *cp | ' '; // to lower case
+            while ((cp < end) && !is_blank(*cp))
+                cp++;
+            continue;
+        }
+        const char* token = cp;
+        uint32_t n = 0;
+        for (; (cp < end) && (*cp >= '0') && (*cp <= '9'); cp++)
+            if (likely(n < 1000))
+                n = n * 10 + *cp - '0';
+        while ((cp < end) && !is_blank(*cp))
+            cp++; // like atoi, ignore trailing junk
+        if (unlikely(cmd.status != CMD_OK))
+            continue;
+        if (unlikely((n == 0) || (n > N_ROOMS))) {
+            cmd.status = CMD_BAD_ROOM;
+            cmd.bad_room = token;
+            cmd.bad_len = cp - token;
+        } else if (unlikely(cmd.n_rooms == N_ARROW_PATH))
+            cmd.status = CMD_TOO_MANY;
+        else
+            cmd.room[cmd.n_rooms++] = n - 1;
+    }
+}
 
-static uint8_t A[N_ROOMS][N_ROOMS];
-static uint8_t B[N_ROOMS][N_ROOMS];
-static uint8_t T[N_ROOMS][N_ROOMS];
+// Remember move and shoot commands, skipping repeats
+static void history_add(void) {
+    if (history_len && (history[0].verb == cmd.verb) && (history[0].n_rooms == cmd.n_rooms)) {
+        uint32_t i;
+        for (i = 0; i < cmd.n_rooms; i++)
+            if (history[0].room[i] != cmd.room[i])
+                break;
+        if (i == cmd.n_rooms)
+            return;
+    }
+    if (history_len < N_HISTORY)
+        history_len++;
+    for (uint32_t i = history_len - 1; i; i--)
+        history[i] = history[i - 1];
+    history[0] = cmd;
+}
+
+// Write a command back as text, return its length
+static uint32_t format_cmd(char* cp, const cmd_t* c) {
+    char* start = cp;
+    *cp++ = c->verb;
+    for (uint32_t i = 0; i < c->n_rooms; i++) {
+        uint32_t n = c->room[i] + 1;
+        *cp++ = ' ';
+        if (n >= 10)
+            *cp++ = '0' + n / 10;
+        *cp++ = '0' + n % 10;
+    }
+    return cp - start;
+}
+
+// Line editor. Backspace erases, up and down arrows recall history.
+static void get_and_parse_cmd(void) {
+    char* line = scratch.con.line;
+    uint32_t len = 0;
+    int h = -1; // history entry shown, -1 for none
+    int c, pending = PICO_ERROR_TIMEOUT;
+    for (;;) {
+        c = (pending != PICO_ERROR_TIMEOUT) ? pending : read_char();
+        pending = PICO_ERROR_TIMEOUT;
+        if (unlikely((c == '\r') || (c == '\n')))
+            break;
+        if (unlikely((c == '\b') || (c == 0x7f))) {
+            if (likely(len)) {
+                len--;
+                echo('\b');
+                echo(' ');
+                echo('\b');
+            }
+        } else if (unlikely(c == 0x1b)) {
+            // ANSI cursor key, ESC [ A or ESC O A for up, B for down, other
+            // complete sequences are dropped. The terminal sends a sequence
+            // in one go, so anything that isn't already following the ESC is
+            // a key of its own.
+            int c1 = getchar_timeout_us(ESC_WAIT_US);
+            if ((c1 != '[') && (c1 != 'O')) {
+                pending = c1;
+                continue;
+            }
+            // Parameter and intermediate bytes up to the final one, as in
+            // ESC [ 3 ~ (delete) or ESC [ 1 ; 5 A (control up)
+            do
+                c = getchar_timeout_us(ESC_WAIT_US);
+            while ((c1 == '[') && (c >= 0x20) && (c <= 0x3f));
+            if ((c < 0x40) || (c > 0x7e)) {
+                pending = c; // cut short, keep what ended it
+                continue;
+            }
+            if ((c == 'A') && (h + 1 < (int)history_len))
+                h++;
+            else if ((c == 'B') && (h >= 0))
+                h--;
+            else
+                continue;
+            for (; len; len--) {
+                echo('\b');
+                echo(' ');
+                echo('\b');
+            }
+            if (h >= 0)
+                len = format_cmd(line, &history[h]);
+            for (uint32_t i = 0; i < len; i++)
+                echo(line[i]);
+        } else if (likely((c >= ' ') && (c < 0x7f))) {
+            if (likely(len < sizeof(scratch.con.line))) {
+                line[len++] = c;
+                echo(c);
+            } else
+                echo('\a'); // line full
+        }
+    }
+    echo(c);
+    if (c == '\r')
+        echo('\n');
+    echo_flush();
+    parse_cmd(line, line + len);
+    if (((cmd.verb == 'm') || (cmd.verb == 's')) && cmd.n_rooms && (cmd.status == CMD_OK))
+        history_add();
+}
+
+#if (N_ROOMS == 20) && (N_TUNNELS == 3) // dodecahedron must have 20 rooms
 
 #if !defined(NDEBUG)
 
@@ -221,80 +501,66 @@ static void matrix_square(uint8_t T[N_ROOMS][N_ROOMS], const uint8_t A[N_ROOMS][
 
 // Return true if cave forms a dodecahedron
 static bool is_dodecahedron(void) {
-    matrix_clear(A);
+    matrix_clear(scratch.m.A);
     for (uint32_t v = 0; v < N_ROOMS; v++)
         for (uint32_t d = 0; d < N_TUNNELS; d++)
-            A[v][buf.rooms[v][d]] = 1;
-    matrix_square(T, A);
-    matrix_square(B, T);
-    matrix_mult(T, A, B);
+            scratch.m.A[v][rooms[v][d]] = 1;
+    matrix_square(scratch.m.T, scratch.m.A);
+    matrix_square(scratch.m.B, scratch.m.T);
+    matrix_mult(scratch.m.T, scratch.m.A, scratch.m.B);
     for (uint32_t v = 0; v < N_ROOMS; v++)
-        if (T[v][v] != 6)
+        if (scratch.m.T[v][v] != 6)
             return false;
     return true;
 }
 
-#endif // N_ROOMS == 20
+#endif // (N_ROOMS == 20) && (N_TUNNELS == 3)
 
 // Cave generator helpers
 
 // Bitmap functions
-static inline void occupy_room(uint32_t b) { cave &= ~(1 << b); }
-static inline bool room_is_empty(uint32_t b) { return (cave & (1 << b)) != 0; }
+static inline void occupy_room(uint32_t b) { cave &= ~(1u << b); }
+static inline bool room_is_empty(uint32_t b) { return (cave & (1u << b)) != 0; }
 static inline uint32_t vacant_room_count(void) { return __builtin_popcount(cave); }
 
-// Try to find player, starting at wumpus
-static bool search_for_arrow_path(const map_t* R, uint32_t r, uint32_t depth, bool print) {
-    flags[r] |= HAZ_VISIT;
-    for (uint32_t t = 0; t < N_TUNNELS; t++) {
-        uint32_t e = *R[r][t];
-        if (unlikely(e == loc))
-            return true;
-        if (likely(depth))
-            if (!(flags[e] & HAZ_VISIT) && search_for_arrow_path(R, e, depth - 1, print)) {
-                if (print)
-                    printf("%d ", R[r][t] + 1);
-                return true;
-            }
-    }
-    return false;
-}
-
-static bool verify_map(const map_t* R) {
-    // Map sanity check
-    for (uint32_t i = 0; i < N_ROOMS; i++)
-        for (uint32_t j = 0; j < N_TUNNELS; j++)
-            if (unlikely(*R[i][j] >= N_ROOMS))
-                return false;
-    uint32_t count[N_ROOMS];
-    for (uint32_t i = 0; i < N_ROOMS; i++)
-        count[i] = 0;
+// Map sanity check
+static bool verify_map(const map_t R) {
     for (uint32_t i = 0; i < N_ROOMS; i++) {
-        // 3 unique tunnels
-        if (unlikely((*R[i][0] == *R[i][1]) || (*R[i][0] == *R[i][2]) || (*R[i][1] == *R[i][2])))
-            return false;
+        unroll(N_TUNNELS)
         for (uint32_t j = 0; j < N_TUNNELS; j++) {
-            // tunnel doesn't circle back
-            if (unlikely(*R[i][j] == i))
+            uint32_t e = R[i][j];
+            // tunnel leads somewhere else
+            if (unlikely((e >= N_ROOMS) || (e == i)))
+                return false;
+            // unique tunnels
+            unroll(N_TUNNELS)
+            for (uint32_t k = 0; k < j; k++)
+                if (unlikely(R[i][k] == e))
+                    return false;
+            // and a tunnel back
+            uint32_t k;
+            unroll(N_TUNNELS)
+            for (k = 0; k < N_TUNNELS; k++)
+                if (R[e][k] == i)
+                    break;
+            if (unlikely(k == N_TUNNELS))
                 return false;
-            count[*R[i][j]]++;
         }
     }
-    // Each room has 3 tunnels
-    for (uint32_t i = 0; i < N_ROOMS; i++)
-        if (unlikely(count[i] != 3))
-            return false;
-    // Is it connected?
-    for (uint32_t r1 = 0; r1 < N_ROOMS - 1; r1++) {
-        loc = r1;
-        for (uint32_t r2 = r1 + 1; r2 < N_ROOMS; r2++) {
-            for (uint32_t j = 0; j < N_ROOMS; j++)
-                flags[j] &= ~HAZ_VISIT;
-            if (unlikely(!search_for_arrow_path(R, r2, N_ROOMS - 1, false)))
-                return false;
+    // Is it connected? Flood the cave from room 0
+    uint32_t seen = 1, edge = 1;
+    while (edge) {
+        uint32_t next = 0;
+        for (; edge; edge &= edge - 1) {
+            uint32_t r = __builtin_ctz(edge);
+            unroll(N_TUNNELS)
+            for (uint32_t t = 0; t < N_TUNNELS; t++)
+                next |= 1u << R[r][t];
         }
+        edge = next & ~seen;
+        seen |= next;
     }
-    return true;
+    return seen == ALL_ROOMS;
 }
 
 // Pick and occupy a random vacant room
@@ -313,8 +579,8 @@ static uint32_t pick_and_occupy_empty_room(void) {
 // Add tunnel from room to room
 static void add_direct_tunnel(uint32_t f, uint32_t t) {
     for (uint32_t i = 0; i < N_TUNNELS; i++)
-        if (buf.rooms[f][i] == UN_MAPPED) {
-            buf.rooms[f][i] = t;
+        if (rooms[f][i] == UN_MAPPED) {
+            rooms[f][i] = t;
             break;
         }
 }
@@ -334,17 +600,26 @@ static inline void exchange(uint8_t* t) {
     }
 }
 
+// Bubble sort a room's tunnels
+static inline void sort_tunnels(uint8_t* t) {
+    unroll(N_TUNNELS)
+    for (uint32_t i = N_TUNNELS - 1; i; i--)
+        unroll(N_TUNNELS)
+        for (uint32_t j = 0; j < i; j++)
+            exchange(t + j);
+}
+
 // Generate a new cave
 static bool directed_graph(void) {
 
     // Clear the tunnel map
     for (uint32_t r = 0; r < N_ROOMS; r++)
         for (uint32_t t = 0; t < N_TUNNELS; t++)
-            buf.rooms[r][t] = UN_MAPPED;
+            rooms[r][t] = UN_MAPPED;
 
-    // Step 1 - Generate a random 20 room cycle.
+    // Step 1 - Generate a random N_ROOMS room cycle.
     uint32_t r = 0, rs = 0;
-    cave = empty_cave;
+    cave = ALL_ROOMS;
     occupy_room(r);
     do {
         uint32_t e = pick_and_occupy_empty_room();
@@ -353,121 +628,176 @@ static bool directed_graph(void) {
     } while (unlikely(cave));
     add_tunnel(r, rs);
 
-    // Step 2 - add the third tunnels... if possible.
-    cave = empty_cave;
-    for (uint32_t n = 0; n < N_ROOMS / 2; n++) {
-        assert(cave); // can't happen
-        r = pick_and_occupy_empty_room();
-        uint32_t save_cave = cave;
-        // disqualify neighbors
-        for (uint32_t t = 0; t < N_TUNNELS; t++)
-            occupy_room(buf.rooms[r][t]);
-        if (unlikely(!cave)) // Oops, can't complete this one!
-            return false;
-        uint32_t e = pick_and_occupy_empty_room();
-        cave = save_cave;
-        occupy_room(e);
-        add_tunnel(r, e);
+    // Step 2 - add the remaining tunnels, a room pairing at a time... if possible.
+    for (uint32_t k = 2; k < N_TUNNELS; k++) {
+        cave = ALL_ROOMS;
+        for (uint32_t n = 0; n < N_ROOMS / 2; n++) {
+            assert(cave); // can't happen
+            r = pick_and_occupy_empty_room();
+            uint32_t save_cave = cave;
+            // disqualify neighbors, so far room r has k tunnels
+            unroll(N_TUNNELS)
+            for (uint32_t t = 0; t < k; t++)
+                occupy_room(rooms[r][t]);
+            if (unlikely(!cave)) // Oops, can't complete this one!
+                return false;
+            uint32_t e = pick_and_occupy_empty_room();
+            cave = save_cave;
+            occupy_room(e);
+            add_tunnel(r, e);
+        }
     }
 
     // Step 3 - sort the tunnels
-    for (uint32_t i = 0; i < N_ROOMS; i++) {
-        exchange(buf.rooms[i]);
-        exchange(buf.rooms[i] + 1);
-        exchange(buf.rooms[i]);
-    }
+    for (uint32_t i = 0; i < N_ROOMS; i++)
+        sort_tunnels(rooms[i]);
 
 #if !defined(NDEBUG)
-    assert(verify_map(buf.rooms));
+    assert(verify_map(rooms));
 #endif // !defined(NDEBUG)
 
     return true;
 }
 
-// Recursive depth 1st neighbor search for hazard
-static bool near(uint32_t r, uint8_t haz, uint32_t depth) {
-    for (uint32_t t = 0; t < N_TUNNELS; t++) {
-        if (flags[buf.rooms[r][t]] & haz)
-            return true;
-        if ((depth > 1) && near(buf.rooms[r][t], haz, depth - 1))
-            return true;
-    }
-    return false;
+// Hazard in an adjoining room
+static inline bool near(uint32_t r, uint8_t haz) {
+    uint8_t f = 0;
+    unroll(N_TUNNELS)
+    for (uint32_t t = 0; t < N_TUNNELS; t++)
+        f |= flags[rooms[r][t]];
+    return (f & haz) != 0;
 }
 
-// State functions
-typedef void* (*func_ptr)(void);
+// Fill the distance table, one breadth first flood per room
+static void measure_cave(void) {
+    for (uint32_t s = 0; s < N_ROOMS; s++) {
+        uint32_t seen = 1u << s, edge = seen;
+        for (uint32_t d = 0; edge; d++) {
+            uint32_t next = 0;
+            for (; edge; edge &= edge - 1) {
+                uint32_t r = __builtin_ctz(edge);
+                dist[s][r] = d;
+                unroll(N_TUNNELS)
+                for (uint32_t t = 0; t < N_TUNNELS; t++)
+                    next |= 1u << rooms[r][t];
+            }
+            edge = next & ~seen;
+            seen |= next;
+        }
+    }
+}
 
-static func_ptr instruction_handler(void);
-static func_ptr init_1st_cave_handler(void);
-static func_ptr init_cave_handler(void);
-static func_ptr setup_handler(void);
-static func_ptr loop_handler(void);
-static func_ptr done_handler(void);
-static func_ptr again_handler(void);
-static func_ptr move_player_handler(void);
-static func_ptr shoot_handler(void);
-static func_ptr move_wumpus_handler(void);
+// States
+typedef enum {
+    ST_NONE, // no such transition
+    ST_INSTRUCTIONS,
+    ST_INIT_1ST_CAVE,
+    ST_INIT_CAVE,
+    ST_SETUP,
+    ST_LOOP,
+    ST_AGAIN,
+    ST_MOVE_PLAYER,
+    ST_SHOOT,
+    ST_MOVE_WUMPUS,
+    ST_DONE,
+    ST_QUIT,
+#if CHEAT
+    ST_DUMP_CAVE,
+    ST_BEST_SHOT,
+    ST_WUMPUS,
+#endif // CHEAT
+    N_STATES
+} state_t;
+
+// Events, returned by the state handlers
+typedef enum {
+    EV_NEXT,      // carry on to the following state
+    EV_NEW_CAVE,  // create a fresh cave
+    EV_SAME_CAVE, // play again in the current cave
+    EV_ENTER,     // player landed in a room
+    EV_PROMPT,    // ask for the next move
+    EV_MOVE,      // player move command
+    EV_SHOOT,     // player shoot command
+#if CHEAT
+    EV_DUMP,      // dump cave cheat command
+    EV_BEST,      // best shot cheat command
+    EV_WUMPUS,    // wumpus behavior cheat command
+#endif // CHEAT
+    EV_WAKE,      // wumpus disturbed
+    EV_GAME_OVER, // won or lost
+    EV_QUIT,      // no more games
+    N_EVENTS
+} event_t;
+
+static void bad_room_message(void) {
+    printf("\n%.*s is not a room number\n", cmd.bad_len, cmd.bad_room);
+}
 
-static bool valid_room_number(int n) {
-    bool b = (n >= 0) && (n < N_ROOMS);
-    if (!b)
-        printf("\n%d is not a room number\n", n + 1);
-    return b;
+// Every room of an arrow's path must be good
+static bool valid_arrow_path(void) {
+    if (unlikely(cmd.status == CMD_BAD_ROOM))
+        bad_room_message();
+    else if (unlikely(cmd.status == CMD_TOO_MANY))
+        printf("\nAn arrow can only go %d rooms!\n", N_ARROW_PATH);
+    return cmd.status == CMD_OK;
 }
 
 // Show instructions
-static func_ptr instruction_handler(void) {
-    printf(intro1, N_ROOMS, N_TUNNELS, N_PITS, N_BATS);
+static event_t instruction_handler(void) {
+    print_packed(intro1, N_ROOMS, N_TUNNELS, N_PITS, N_BATS);
     printf("Hit RETURN to continue ");
     fflush(stdout);
     get_and_parse_cmd();
     printf("\n");
-    printf(intro2, N_ARROWS, N_ARROW_PATH);
+    print_packed(intro2, N_ARROWS, N_ARROW_PATH, N_TUNNELS);
     printf("Hit RETURN to continue ");
     fflush(stdout);
     get_and_parse_cmd();
     printf("\n");
-    printf((char*)intro3);
-    return (func_ptr)init_1st_cave_handler;
+    print_packed(intro3);
+    return EV_NEXT;
 }
 
 // Create or load cave from flash
-static func_ptr init_1st_cave_handler(void) {
-    const map_t* flash = (void*)(XIP_BASE + PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE);
+static event_t init_1st_cave_handler(void) {
+    const uint8_t(*flash)[N_TUNNELS] = (void*)(XIP_BASE + PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE);
     if (!verify_map(flash))
-        return (func_ptr)init_cave_handler;
+        return EV_NEW_CAVE;
     printf("\nContinue with saved cave (Y/n) ? ");
     fflush(stdout);
     get_and_parse_cmd();
-    if ((argc == 0) || (*argv[0] == 'y')) {
+    if ((cmd.verb == 0) || (cmd.verb == 'y')) {
         for (uint32_t r = 0; r < N_ROOMS; r++)
             for (uint32_t t = 0; t < N_TUNNELS; t++)
-                buf.rooms[r][t] = *flash[r][t];
-        return (func_ptr)setup_handler;
+                rooms[r][t] = flash[r][t];
+        measure_cave();
+        return EV_SAME_CAVE;
     }
-    return (func_ptr)init_cave_handler;
+    return EV_NEW_CAVE;
 }
 
 // Create a fresh cave
-static func_ptr init_cave_handler(void) {
+static event_t init_cave_handler(void) {
     printf("\nCreating new cave map.");
     while (!directed_graph())
         ;
-#if N_ROOMS == 20
+#if (N_ROOMS == 20) && (N_TUNNELS == 3)
     if (unlikely(is_dodecahedron()))
         printf(" Ooh! You're entering the rarest of caves, a dodecahedron.");
-#endif // N_ROOMS == 20
+#endif // (N_ROOMS == 20) && (N_TUNNELS == 3)
     printf("\n");
+    measure_cave();
     new_cave = true;
-    return (func_ptr)setup_handler;
+    return EV_NEXT;
 }
 
 // Setup a new game in the current cave
-static func_ptr setup_handler(void) {
+static event_t setup_handler(void) {
     // put in player, wumpus, pits and bats
     uint32_t i, j;
     arrow = N_ARROWS;
+    arrow_path = 0;
+    wumpus_slain = false;
     for (i = 0; i < N_ROOMS; i++)
         flags[i] = 0;
     for (i = 0; i < N_PITS;) {
@@ -494,47 +824,51 @@ static func_ptr setup_handler(void) {
             break;
         }
     }
-    return (func_ptr)loop_handler;
+    return EV_NEXT;
 }
 
 // Just landed in new room, game loop
-static func_ptr loop_handler(void) {
+static event_t loop_handler(void) {
     printf("\nYou are in room %d", (int)loc + 1);
     // check for hazards
     if (flags[loc] & HAZ_PIT) {
         printf(". You fell into a pit. You lose.\n");
-        return (func_ptr)done_handler;
+        return EV_GAME_OVER;
     }
     if (flags[loc] & HAZ_WUMPUS) {
         printf(". You were eaten by the wumpus. You lose.\n");
-        return (func_ptr)done_handler;
+        return EV_GAME_OVER;
     }
     if (flags[loc] & HAZ_BAT) {
         printf(". Theres a bat in your room. Carying you away.\n");
         loc = random_number(N_ROOMS);
-        return (func_ptr)loop_handler;
+        return EV_ENTER;
     }
     // anything nearby?
-    if (near(loc, HAZ_WUMPUS, 2))
+    if (dist[loc][wloc] <= 2)
         printf(". I smell a wumpus");
-    if (near(loc, HAZ_BAT, 1))
+    if (near(loc, HAZ_BAT))
         printf(". Bats nearby");
-    if (near(loc, HAZ_PIT, 1))
+    if (near(loc, HAZ_PIT))
         printf(". I feel a draft");
     // travel options
-    printf(". There are tunnels to rooms %d, %d and %d.\n", buf.rooms[loc][0] + 1,
-           buf.rooms[loc][1] + 1, buf.rooms[loc][2] + 1);
-    return (func_ptr)again_handler;
+    printf(". There are tunnels to rooms");
+    for (uint32_t t = 0; t < N_TUNNELS; t++)
+        printf("%s%d", (t == 0) ? " " : (t == N_TUNNELS - 1) ? " and " : ", ", rooms[loc][t] + 1);
+    printf(".\n");
+    return EV_PROMPT;
 }
 
-#if !defined(NDEBUG) || CHEAT
+#if CHEAT
 // Dump the cave cheat command
-static func_ptr dump_cave_handler(void) {
+static event_t dump_cave_handler(void) {
     for (uint32_t r = 0; r < N_ROOMS; r++) {
         if ((r & 3) == 0)
             printf("\n");
-        printf("%2lu:%2d %2d %2d  ", r + 1, buf.rooms[r][0] + 1, buf.rooms[r][1] + 1,
-               buf.rooms[r][2] + 1);
+        printf("%2lu:", r + 1);
+        for (uint32_t t = 0; t < N_TUNNELS; t++)
+            printf("%2d ", rooms[r][t] + 1);
+        printf(" ");
     }
     printf("\n\nPlayer:%2lu  Wumpus:%2lu  Pits:", loc + 1, wloc + 1);
     for (uint32_t r = 0; r < N_ROOMS; r++)
@@ -545,164 +879,216 @@ static func_ptr dump_cave_handler(void) {
         if (flags[r] & HAZ_BAT)
             printf("%2lu ", r + 1);
     printf("\n");
-    return (func_ptr)again_handler;
+    return EV_PROMPT;
 }
 
 // Find the best shot cheat command
-static func_ptr best_shot_handler(void) {
-    printf("\nBest shot: ");
-    uint32_t i;
-    for (i = 0; i <= N_ARROWS; i++) {
-        for (uint32_t j = 0; j < N_ROOMS; j++)
-            flags[j] &= ~HAZ_VISIT;
-        if (likely(search_for_arrow_path(buf.rooms, wloc, i, true))) {
-            printf("%lu", wloc + 1);
-            break;
+static event_t best_shot_handler(void) {
+    printf("\nBest shot:");
+    uint32_t d = dist[loc][wloc];
+    if (unlikely(d > N_ARROW_PATH))
+        printf(" none");
+    else
+        // each step takes the arrow one tunnel closer to the wumpus
+        for (uint32_t r = loc; d--;) {
+            uint32_t t = 0;
+            while (dist[rooms[r][t]][wloc] != d)
+                t++;
+            r = rooms[r][t];
+            printf(" %lu", r + 1);
         }
-    }
-    if (unlikely(i == N_ARROWS))
-        printf("none");
     printf("\n");
-    return (func_ptr)again_handler;
+    return EV_PROMPT;
 }
 
-#endif // NDEBUG
+// Pick the next wumpus behavior cheat command
+static const char* const wumpus_name[N_WUMPUS] = {"wanders", "flees", "stalks", "dodges"};
+
+static event_t wumpus_handler(void) {
+    wumpus = (wumpus + 1) % N_WUMPUS;
+    printf("\nThe wumpus %s\n", wumpus_name[wumpus]);
+    return EV_PROMPT;
+}
+
+#endif // CHEAT
 
 // What are you going to do here?
-static func_ptr again_handler(void) {
+static event_t again_handler(void) {
     printf("\nMove or shoot (m/s) ? ");
     fflush(stdout);
     get_and_parse_cmd();
-    if (argc == 0)
-        return (func_ptr)again_handler;
-    switch (*argv[0]) {
+    if (cmd.verb == 0)
+        return EV_PROMPT;
+    switch (cmd.verb) {
     case 'm':
-        return (func_ptr)move_player_handler;
+        return EV_MOVE;
     case 's':
-        return (func_ptr)shoot_handler;
-#if !defined(NDEBUG) || CHEAT
+        return EV_SHOOT;
+#if CHEAT
     case 'd': // dump cave map
-        return (func_ptr)dump_cave_handler;
+        return EV_DUMP;
     case 'b': // find best shot
-        return (func_ptr)best_shot_handler;
-#endif // NDEBUG
+        return EV_BEST;
+    case 'w': // change wumpus behavior
+        return EV_WUMPUS;
+#endif // CHEAT
     }
     printf("\nWhat ?\n");
-    return (func_ptr)again_handler;
+    return EV_PROMPT;
 }
 
 // Move on to next room
-static func_ptr move_player_handler(void) {
-    if (argc < 2) {
-        printf("\nwhich room ?\n");
-        return (func_ptr)again_handler;
+static event_t move_player_handler(void) {
+    // only the 1st room counts, anything after it is ignored
+    if (cmd.n_rooms == 0) {
+        if (cmd.status == CMD_BAD_ROOM)
+            bad_room_message();
+        else
+            printf("\nwhich room ?\n");
+        return EV_PROMPT;
     }
-    int r, t;
-    r = atoi(argv[1]) - 1;
-    if (!valid_room_number(r))
-        return (func_ptr)again_handler;
-    if (r < N_ROOMS)
-        for (t = 0; t < N_TUNNELS; t++)
-            if (r == buf.rooms[loc][t]) {
-                loc = r;
-                if (flags[r] & HAZ_WUMPUS)
-                    return (func_ptr)move_wumpus_handler;
-                return (func_ptr)loop_handler;
-            }
+    uint32_t r = cmd.room[0];
+    for (uint32_t t = 0; t < N_TUNNELS; t++)
+        if (r == rooms[loc][t]) {
+            loc = r;
+            if (flags[r] & HAZ_WUMPUS)
+                return EV_WAKE;
+            return EV_ENTER;
+        }
     printf("\nYou hit the wall!\n");
-    return (func_ptr)again_handler;
+    return EV_PROMPT;
 }
 
 // Shoot an arrow
-static func_ptr shoot_handler(void) {
-    if (unlikely(argc < 2)) {
+static event_t shoot_handler(void) {
+    if (unlikely(!valid_arrow_path()))
+        return EV_PROMPT;
+    if (unlikely(cmd.n_rooms == 0)) {
         printf("\nWhich tunnel(s) ?\n");
-        return (func_ptr)again_handler;
+        return EV_PROMPT;
     }
-    for (uint32_t i = 1; i < argc; i++)
-        if (unlikely(!valid_room_number(atoi(argv[i]) - 1)))
-            return (func_ptr)again_handler;
-    uint32_t t, r = atoi(argv[1]) - 1;
+    uint32_t t, r = cmd.room[0];
     for (t = 0; t < N_TUNNELS; t++)
-        if (buf.rooms[loc][t] == r)
+        if (rooms[loc][t] == r)
             break;
     if (unlikely(t == N_TUNNELS)) {
         printf("\nNo tunnel to that room!\n");
-        return (func_ptr)again_handler;
+        return EV_PROMPT;
     }
     printf("\n");
     int l = loc;
-    for (uint32_t i = 0; i < N_ARROW_PATH; i++) {
-        if (i > argc - 2)
-            break;
-        r = atoi(argv[i + 1]) - 1;
+    arrow_path = 0;
+    for (uint32_t i = 0; i < cmd.n_rooms; i++) {
+        r = cmd.room[i];
         for (t = 0; t < N_TUNNELS; t++)
-            if (r == buf.rooms[l][t])
+            if (r == rooms[l][t])
                 break;
         if (t == N_TUNNELS)
             t = random_number(N_TUNNELS);
-        r = buf.rooms[l][t];
+        r = rooms[l][t];
+        arrow_path |= 1u << r;
         printf("~>");
         fflush(stdout);
-        sleep_ms(500);
+        sleep_ms(ARROW_DELAY_MS);
         printf("%d", (int)r + 1);
         fflush(stdout);
-        sleep_ms(500);
+        sleep_ms(ARROW_DELAY_MS);
         if (r == loc) {
             printf("\n\nYou shot yourself! You lose.\n");
-            return (func_ptr)done_handler;
+            return EV_GAME_OVER;
         }
         if (flags[r] & HAZ_WUMPUS) {
             printf("\n\nYou slew the wumpus in room %d. You win!\n", (int)r + 1);
-            return (func_ptr)done_handler;
+            wumpus_slain = true;
+            return EV_GAME_OVER;
         }
         l = r;
     }
     printf("\n\nYou missed!");
     if (--arrow == 0) {
         printf(" That was your last shot! You lose.\n");
-        return (func_ptr)done_handler;
+        return EV_GAME_OVER;
     }
     printf("\n");
-    return (func_ptr)move_wumpus_handler;
+    return EV_WAKE;
+}
+
+// How much the wumpus likes a room, higher is better
+static inline uint32_t wumpus_score(uint32_t r) {
+    switch (wumpus) {
+    case WUMPUS_FLEE:
+        return dist[r][loc];
+    case WUMPUS_STALK:
+        return N_ROOMS - dist[r][loc];
+    case WUMPUS_DODGE:
+        return !(arrow_path & (1u << r));
+    }
+    return 0;
+}
+
+// Best of staying put or taking a tunnel, ties broken at random
+static uint32_t wumpus_choice(void) {
+    if (wumpus == WUMPUS_RANDOM) {
+        uint32_t i = random_number(N_TUNNELS + 1);
+        return (i == N_TUNNELS) ? wloc : rooms[wloc][i];
+    }
+    uint32_t best = wloc, score = wumpus_score(wloc), ties = 1;
+    unroll(N_TUNNELS)
+    for (uint32_t t = 0; t < N_TUNNELS; t++) {
+        uint32_t r = rooms[wloc][t], s = wumpus_score(r);
+        if (s > score) {
+            best = r;
+            score = s;
+            ties = 1;
+        } else if ((s == score) && (random_number(++ties) == 0))
+            best = r;
+    }
+    return best;
 }
 
 // Wumpus disturbed, time to move it
-static func_ptr move_wumpus_handler(void) {
-    int i;
+static event_t move_wumpus_handler(void) {
     flags[wloc] &= ~HAZ_WUMPUS;
-    i = random_number(N_TUNNELS + 1);
-    if (likely(i != N_TUNNELS))
-        wloc = buf.rooms[wloc][i];
+    uint32_t w = wumpus_choice();
+    bool moved = w != wloc;
+    wloc = w;
     if (unlikely(wloc == loc)) {
-        printf("\nThe wumpus %sate you. You lose.\n", ((i == N_TUNNELS) ? "" : "moved and "));
-        return (func_ptr)done_handler;
+        printf("\nThe wumpus %sate you. You lose.\n", moved ? "moved and " : "");
+        return EV_GAME_OVER;
     }
     flags[wloc] |= HAZ_WUMPUS;
-    return (func_ptr)loop_handler;
+    return EV_ENTER;
 }
 
 // Game over. Play again?
-static func_ptr done_handler(void) {
+static event_t done_handler(void) {
     printf("\nAnother game (Y/n) ? ");
     fflush(stdout);
     get_and_parse_cmd();
-    if ((argc == 0) || (*argv[0] == 'y')) {
+    if ((cmd.verb == 0) || (cmd.verb == 'y')) {
         printf("\nSame room setup (Y/n) ? ");
         fflush(stdout);
         get_and_parse_cmd();
-        if ((argc == 0) || (*argv[0] == 'y'))
-            return (func_ptr)setup_handler;
+        if ((cmd.verb == 0) || (cmd.verb == 'y'))
+            return EV_SAME_CAVE;
         else
-            return (func_ptr)init_cave_handler;
+            return EV_NEW_CAVE;
     }
+    return EV_QUIT;
+}
+
+// Save the cave if it's new, then halt
+static event_t quit_handler(void) {
     if (new_cave) {
         printf("\nSaving cave for later...");
         fflush(stdout);
         const uint32_t offset = PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE;
+        // pad the map out to a full flash page
+        for (uint32_t i = 0; i < FLASH_PAGE_SIZE; i++)
+            scratch.sector[i] = (i < sizeof(rooms)) ? ((const uint8_t*)rooms)[i] : 0xff;
         uint32_t ints = save_and_disable_interrupts();
         flash_range_erase(offset, FLASH_SECTOR_SIZE);
-        flash_range_program(offset, buf.rooms[0], FLASH_PAGE_SIZE);
+        flash_range_program(offset, scratch.sector, FLASH_PAGE_SIZE);
         restore_interrupts(ints);
         printf("\n");
     }
@@ -710,29 +1096,76 @@ static func_ptr done_handler(void) {
     printf("\nBye!\n\n");
     for (;;)
         __wfi();
+    __builtin_unreachable();
 }
 
+// State handlers
+static event_t (*const handler[N_STATES])(void) = {
+    [ST_INSTRUCTIONS] = instruction_handler,
+    [ST_INIT_1ST_CAVE] = init_1st_cave_handler,
+    [ST_INIT_CAVE] = init_cave_handler,
+    [ST_SETUP] = setup_handler,
+    [ST_LOOP] = loop_handler,
+    [ST_AGAIN] = again_handler,
+    [ST_MOVE_PLAYER] = move_player_handler,
+    [ST_SHOOT] = shoot_handler,
+    [ST_MOVE_WUMPUS] = move_wumpus_handler,
+    [ST_DONE] = done_handler,
+    [ST_QUIT] = quit_handler,
+#if CHEAT
+    [ST_DUMP_CAVE] = dump_cave_handler,
+    [ST_BEST_SHOT] = best_shot_handler,
+    [ST_WUMPUS] = wumpus_handler,
+#endif // CHEAT
+};
+
+// State transitions, next state for each state and event
+// clang-format off
+static const uint8_t transition[N_STATES][N_EVENTS] = {
+    [ST_INSTRUCTIONS]  = {[EV_NEXT] = ST_INIT_1ST_CAVE},
+    [ST_INIT_1ST_CAVE] = {[EV_NEW_CAVE] = ST_INIT_CAVE, [EV_SAME_CAVE] = ST_SETUP},
+    [ST_INIT_CAVE]     = {[EV_NEXT] = ST_SETUP},
+    [ST_SETUP]         = {[EV_NEXT] = ST_LOOP},
+    [ST_LOOP]          = {[EV_ENTER] = ST_LOOP, [EV_PROMPT] = ST_AGAIN, [EV_GAME_OVER] = ST_DONE},
+    [ST_AGAIN]         = {[EV_PROMPT] = ST_AGAIN, [EV_MOVE] = ST_MOVE_PLAYER, [EV_SHOOT] = ST_SHOOT,
+#if CHEAT
+                          [EV_DUMP] = ST_DUMP_CAVE, [EV_BEST] = ST_BEST_SHOT, [EV_WUMPUS] = ST_WUMPUS,
+#endif // CHEAT
+                         },
+    [ST_MOVE_PLAYER]   = {[EV_PROMPT] = ST_AGAIN, [EV_ENTER] = ST_LOOP, [EV_WAKE] = ST_MOVE_WUMPUS},
+    [ST_SHOOT]         = {[EV_PROMPT] = ST_AGAIN, [EV_WAKE] = ST_MOVE_WUMPUS, [EV_GAME_OVER] = ST_DONE},
+    [ST_MOVE_WUMPUS]   = {[EV_ENTER] = ST_LOOP, [EV_GAME_OVER] = ST_DONE},
+    [ST_DONE]          = {[EV_NEW_CAVE] = ST_INIT_CAVE, [EV_SAME_CAVE] = ST_SETUP, [EV_QUIT] = ST_QUIT},
+#if CHEAT
+    [ST_DUMP_CAVE]     = {[EV_PROMPT] = ST_AGAIN},
+    [ST_BEST_SHOT]     = {[EV_PROMPT] = ST_AGAIN},
+    [ST_WUMPUS]        = {[EV_PROMPT] = ST_AGAIN},
+#endif // CHEAT
+};
+// clang-format on
+
 // Forever loop
 int main(void) {
     stdio_init();
 
-#if !defined(NDEBUG) && (N_ROOMS == 20)
+#if !defined(NDEBUG) && (N_ROOMS == 20) && (N_TUNNELS == 3)
     // test the dodecahedron detector
     for (uint32_t r = 0; r < N_ROOMS; r++)
         for (uint32_t t = 0; t < N_TUNNELS; t++)
-            buf.rooms[r][t] = dodecahedron[r][t];
+            rooms[r][t] = dodecahedron[r][t];
     assert(is_dodecahedron());
-#endif // !defined(NDEBUG) && (N_ROOMS == 20)
+#endif // !defined(NDEBUG) && (N_ROOMS == 20) && (N_TUNNELS == 3)
 
-    empty_cave = (uint32_t)-1 >> (32 - N_ROOMS);
-    printf("%sWelcome. Instructions (y/N) ? ", banner);
+    print_packed(banner);
+    printf("Welcome. Instructions (y/N) ? ");
     get_and_parse_cmd();
 
     srand(time_us_32());
 
-    func_ptr state = (func_ptr)(((argc == 0) || (*argv[0] == 'n')) ? init_1st_cave_handler
-                                                                   : instruction_handler);
+    state_t state = ((cmd.verb == 0) || (cmd.verb == 'n')) ? ST_INIT_1ST_CAVE : ST_INSTRUCTIONS;
 
-    for (;; state = state())
-        ;
+    for (;;) {
+        state = transition[state][handler[state]()];
+        assert(state != ST_NONE);
+    }
 }